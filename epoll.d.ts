@@ -9,7 +9,7 @@ export class Epoll {
 
   get closed(): boolean;
 
-  add(fd: number, events: number): Epoll;
+  add(fd: number, events: number, timeout?: number): Epoll;
   close(): void;
   remove(fd: number): Epoll;
   modify(fd: number, events: number): Epoll;
@@ -22,6 +22,7 @@ export class Epoll {
   static EPOLLHUP: number;
   static EPOLLET: number;
   static EPOLLONESHOT: number;
+  static EPOLLTIMEOUT: number;
 }
 
 // TODO - should it export as possibly null?
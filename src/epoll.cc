@@ -1,6 +1,8 @@
 #ifdef __linux__
 
 #include <errno.h>
+#include <math.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <unistd.h>
@@ -66,6 +68,7 @@ namespace epoll
                                                         StaticValue("EPOLLHUP", Napi::Number::New(env, EPOLLHUP), napi_default),
                                                         StaticValue("EPOLLET", Napi::Number::New(env, EPOLLET), napi_default),
                                                         StaticValue("EPOLLONESHOT", Napi::Number::New(env, EPOLLONESHOT), napi_default),
+                                                        StaticValue("EPOLLTIMEOUT", Napi::Number::New(env, TimeoutEvent), napi_default),
                                                     });
 
     exports.Set("Epoll", func);
@@ -88,7 +91,7 @@ namespace epoll
     if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber())
     {
       Napi::Error::New(env, "incorrect arguments passed to add"
-                            "(int fd, int events)")
+                            "(int fd, int events[, int timeout])")
           .ThrowAsJavaScriptException();
       return env.Null();
     }
@@ -96,6 +99,29 @@ namespace epoll
     int fd = info[0].As<Napi::Number>().Int32Value();
     int events = info[1].As<Napi::Number>().Int32Value();
 
+    if (events & TimeoutEvent)
+    {
+      Napi::Error::New(env, "EPOLLTIMEOUT can't be passed to add").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+
+    // Optional inactivity timeout in milliseconds, 0 or undefined disables it
+    uint32_t timeout = 0;
+    if (info.Length() >= 3 && !info[2].IsUndefined())
+    {
+      // Only whole milliseconds are accepted, a fraction would silently truncate
+      double value = info[2].IsNumber() ? info[2].As<Napi::Number>().DoubleValue() : -1;
+      if (!(value >= 0 && value <= UINT32_MAX) || value != floor(value))
+      {
+        Napi::Error::New(env, "incorrect arguments passed to add"
+                              "(int fd, int events[, int timeout])")
+            .ThrowAsJavaScriptException();
+        return env.Null();
+      }
+
+      timeout = static_cast<uint32_t>(value);
+    }
+
     // Take a reference or create the watcher
     if (!watcher_)
     {
@@ -114,7 +140,7 @@ namespace epoll
       }
     }
 
-    int err = watcher_->Add(fd, events, this);
+    int err = watcher_->Add(fd, events, this, timeout);
     if (err != 0)
     {
       Napi::Error::New(env, strerror(err)).ThrowAsJavaScriptException();
@@ -152,11 +178,17 @@ namespace epoll
       return env.Null();
     }
 
-    // TODO - validate this is watching fd
+    int events = info[1].As<Napi::Number>().Int32Value();
+    if (events & TimeoutEvent)
+    {
+      Napi::Error::New(env, "EPOLLTIMEOUT can't be passed to modify").ThrowAsJavaScriptException();
+      return env.Null();
+    }
 
     int err = watcher_->Modify(
         info[0].As<Napi::Number>().Int32Value(),
-        info[1].As<Napi::Number>().Int32Value());
+        events,
+        this);
     if (err != 0)
     {
       Napi::Error::New(env, strerror(err)).ThrowAsJavaScriptException();
@@ -184,7 +216,7 @@ namespace epoll
 
     int fd = info[0].As<Napi::Number>().Int32Value();
 
-    int err = watcher_->Remove(fd);
+    int err = watcher_->Remove(fd, this);
 
     fds_.remove(fd);
     if (fds_.empty() && watcher_)
@@ -218,7 +250,7 @@ namespace epoll
 
     for (int fd : fds_)
     {
-      int err = watcher_->Remove(fd);
+      int err = watcher_->Remove(fd, this);
       if (err != 0)
         error = err; // TODO - This will only return one of many errors
     }
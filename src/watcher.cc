@@ -4,13 +4,72 @@
 #include <pthread.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <list>
+#include <vector>
 #include "watcher.h"
 #include "epoll.h"
 
 namespace epoll
 {
+    static Subscription *FindSubscription(Registration &registration, Epoll *epoll)
+    {
+        for (Subscription &subscription : registration.subscriptions)
+        {
+            if (subscription.epoll == epoll)
+                return &subscription;
+        }
+        return nullptr;
+    }
+
+    // The kernel mask is the union of the events of every armed subscription. EPOLLET and
+    // EPOLLONESHOT are only passed on when every armed subscription asks for them, otherwise
+    // EPOLLONESHOT is honoured per subscription when events are dispatched.
+    static uint32_t RegistrationEvents(const Registration &registration)
+    {
+        const uint32_t flags = EPOLLET | EPOLLONESHOT;
+
+        uint32_t events = 0;
+        uint32_t commonFlags = flags;
+        bool anyArmed = false;
+
+        for (const Subscription &subscription : registration.subscriptions)
+        {
+            if (!subscription.armed)
+                continue;
+
+            anyArmed = true;
+            events |= subscription.events & ~flags;
+            commonFlags &= subscription.events;
+        }
+
+        // With nothing armed the registration is left to fire at most once more, for
+        // EPOLLERR or EPOLLHUP, which then has nobody to be dispatched to
+        if (!anyArmed)
+            return EPOLLONESHOT;
+
+        return events | commonFlags;
+    }
+
+    static int UpdateRegistration(WatcherContext *context, int fd, Registration &registration, bool force)
+    {
+        uint32_t events = RegistrationEvents(registration);
+        if (!force && events == registration.events)
+            return 0;
+
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = fd;
+
+        if (epoll_ctl(context->epfd, EPOLL_CTL_MOD, fd, &event) == -1)
+            return errno;
+
+        registration.events = events;
+
+        return 0;
+    }
+
     // Transform native data into JS data, passing it to the provided
     // `callback` -- the TSFN's JavaScript function.
     void CallJs(Napi::Env env, Napi::Function callback, Context *context,
@@ -26,10 +85,93 @@ namespace epoll
             // registered interest in the event may no longer have this interest. If
             // this is the case, the event will be silently ignored.
 
-            std::map<int, Epoll *>::iterator it = context->fd2epoll.find(data->event.data.fd);
-            if (it != context->fd2epoll.end())
+            std::vector<std::pair<Epoll *, uint32_t>> &targets = context->targets;
+            targets.clear();
+
+            int fd = data->event.data.fd;
+
+            std::map<int, std::pair<int, Epoll *>>::iterator timerIt = context->timer2subscription.find(fd);
+            if (data->error == 0 && timerIt != context->timer2subscription.end())
+            {
+                // An inactivity timer expired. If the fd became ready, or the subscription
+                // fired as a one-shot, after the expiry was picked up by the native thread
+                // the timer will have been re-armed or paused. Both reset the expiration
+                // count and make this read fail, so the stale expiry is dropped.
+                uint64_t expirations;
+                if (read(timerIt->first, &expirations, sizeof(expirations)) == sizeof(expirations))
+                {
+                    fd = timerIt->second.first;
+                    targets.push_back(std::make_pair(timerIt->second.second, TimeoutEvent));
+                }
+            }
+            else
             {
-                it->second->DispatchEvent(env, data->error, &data->event);
+                std::map<int, Registration>::iterator it = context->fd2registration.find(fd);
+                if (it != context->fd2registration.end())
+                {
+                    Registration &registration = it->second;
+
+                    if (data->error)
+                    {
+                        for (Subscription &subscription : registration.subscriptions)
+                            targets.push_back(std::make_pair(subscription.epoll, 0u));
+                    }
+                    else
+                    {
+                        // The kernel disables a EPOLLONESHOT registration once it has fired
+                        if (registration.events & EPOLLONESHOT)
+                            registration.events = EPOLLONESHOT;
+
+                        for (Subscription &subscription : registration.subscriptions)
+                        {
+                            if (!subscription.armed)
+                                continue;
+
+                            // EPOLLERR and EPOLLHUP are always reported, as they would be by the kernel
+                            uint32_t events = data->event.events & (subscription.events | EPOLLERR | EPOLLHUP);
+                            if (events == 0)
+                                continue;
+
+                            if (subscription.events & EPOLLONESHOT)
+                                subscription.armed = false;
+
+                            if (subscription.timerfd != -1)
+                            {
+                                // The fd showed some readiness, so push the inactivity timer back. A
+                                // fired one-shot can't see readiness until it is modified, so its
+                                // timer is paused until then instead.
+                                struct itimerspec paused = {};
+                                timerfd_settime(subscription.timerfd, 0, subscription.armed ? &subscription.timeout : &paused, nullptr);
+                            }
+
+                            targets.push_back(std::make_pair(subscription.epoll, events));
+                        }
+
+                        // Re-enable the registration for the remaining subscriptions if the kernel
+                        // disabled it, or narrow it now that a one-shot subscription has fired
+                        UpdateRegistration(context, fd, registration, false);
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < targets.size(); i++)
+            {
+                Epoll *epoll = targets[i].first;
+
+                // An earlier callback may have removed the subscription. There is no earlier
+                // callback for the first target, so a single subscriber skips the lookup.
+                if (i > 0)
+                {
+                    std::map<int, Registration>::iterator it = context->fd2registration.find(fd);
+                    if (it == context->fd2registration.end() || FindSubscription(it->second, epoll) == nullptr)
+                        continue;
+                }
+
+                struct epoll_event event;
+                event.events = targets[i].second;
+                event.data.fd = fd;
+
+                epoll->DispatchEvent(env, data->error, &event);
             }
         }
 
@@ -129,6 +271,17 @@ namespace epoll
 
     void EpollWatcher::Cleanup()
     {
+        for (std::map<int, Registration>::iterator it = context->fd2registration.begin(); it != context->fd2registration.end(); ++it)
+        {
+            for (Subscription &subscription : it->second.subscriptions)
+            {
+                if (subscription.timerfd != -1)
+                    close(subscription.timerfd);
+            }
+        }
+        context->fd2registration.clear();
+        context->timer2subscription.clear();
+
         if (context->epfd != -1)
         {
             close(context->epfd);
@@ -140,54 +293,172 @@ namespace epoll
         context = nullptr;
     }
 
-    int EpollWatcher::Add(int fd, uint32_t events, Epoll *epoll)
+    int EpollWatcher::Add(int fd, uint32_t events, Epoll *epoll, uint32_t timeoutMs)
     {
         if (context == nullptr)
             return 111;
 
-        if (context->fd2epoll.count(fd) > 0)
+        std::map<int, Registration>::iterator it = context->fd2registration.find(fd);
+        if (it != context->fd2registration.end() && FindSubscription(it->second, epoll) != nullptr)
         {
-            // Already being watched somewhere
-            return 111;
+            // Already being watched by this Epoll
+            return EEXIST;
         }
 
-        struct epoll_event event;
-        event.events = events;
-        event.data.fd = fd;
+        Subscription subscription;
+        subscription.epoll = epoll;
+        subscription.events = events;
+        subscription.armed = true;
+        subscription.timerfd = -1;
+
+        if (it == context->fd2registration.end())
+        {
+            // First subscription, so the fd is registered with exactly the requested events
+            struct epoll_event event;
+            event.events = events;
+            event.data.fd = fd;
+
+            if (epoll_ctl(context->epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+                return errno;
+
+            it = context->fd2registration.insert(std::pair<int, Registration>(fd, Registration())).first;
+            it->second.events = events;
+            it->second.subscriptions.push_back(subscription);
+        }
+        else
+        {
+            // Widen the existing registration. The modification is passed on even when it already
+            // covers the events, so the kernel re-reports readiness that an EPOLLET registration
+            // has already delivered to the other subscriptions.
+            it->second.subscriptions.push_back(subscription);
+
+            int err = UpdateRegistration(context, fd, it->second, true);
+            if (err != 0)
+            {
+                it->second.subscriptions.pop_back();
+                return err;
+            }
+        }
+
+        if (timeoutMs > 0)
+        {
+            int err = AddTimer(fd, it->second.subscriptions.back(), timeoutMs);
+            if (err != 0)
+            {
+                Remove(fd, epoll);
+                return err;
+            }
+        }
 
-        if (epoll_ctl(context->epfd, EPOLL_CTL_ADD, fd, &event) == -1)
+        return 0;
+    }
+
+    int EpollWatcher::AddTimer(int fd, Subscription &subscription, uint32_t timeoutMs)
+    {
+        // The timer lives in the same epfd as the fd it guards, so expiries are picked up by
+        // the existing native thread and it costs nothing while the fd keeps showing readiness
+        int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerfd == -1)
             return errno;
 
-        context->fd2epoll.insert(std::pair<int, Epoll *>(fd, epoll));
+        subscription.timeout.it_interval.tv_sec = 0;
+        subscription.timeout.it_interval.tv_nsec = 0;
+        subscription.timeout.it_value.tv_sec = timeoutMs / 1000;
+        subscription.timeout.it_value.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = timerfd;
+
+        if (timerfd_settime(timerfd, 0, &subscription.timeout, nullptr) == -1 ||
+            epoll_ctl(context->epfd, EPOLL_CTL_ADD, timerfd, &event) == -1)
+        {
+            int err = errno;
+            close(timerfd);
+            return err;
+        }
+
+        subscription.timerfd = timerfd;
+        context->timer2subscription.insert(std::make_pair(timerfd, std::make_pair(fd, subscription.epoll)));
 
         return 0;
     }
 
-    int EpollWatcher::Modify(int fd, uint32_t events)
+    void EpollWatcher::RemoveTimer(Subscription &subscription)
+    {
+        if (subscription.timerfd == -1)
+            return;
+
+        epoll_ctl(context->epfd, EPOLL_CTL_DEL, subscription.timerfd, 0);
+        close(subscription.timerfd);
+
+        context->timer2subscription.erase(subscription.timerfd);
+        subscription.timerfd = -1;
+    }
+
+    int EpollWatcher::Modify(int fd, uint32_t events, Epoll *epoll)
     {
         if (context == nullptr)
             return 111;
 
-        struct epoll_event event;
-        event.events = events;
-        event.data.fd = fd;
+        std::map<int, Registration>::iterator it = context->fd2registration.find(fd);
+        if (it == context->fd2registration.end())
+            return ENOENT;
 
-        if (epoll_ctl(context->epfd, EPOLL_CTL_MOD, fd, &event) == -1)
-            return errno;
+        Subscription *subscription = FindSubscription(it->second, epoll);
+        if (subscription == nullptr)
+            return ENOENT;
+
+        uint32_t oldEvents = subscription->events;
+        bool oldArmed = subscription->armed;
+
+        subscription->events = events;
+        subscription->armed = true;
+
+        // Always pass the modification on, it is also how EPOLLET users get readiness re-evaluated
+        int err = UpdateRegistration(context, fd, it->second, true);
+        if (err != 0)
+        {
+            subscription->events = oldEvents;
+            subscription->armed = oldArmed;
+            return err;
+        }
+
+        // Restart the inactivity timer, which was paused if a one-shot had fired
+        if (subscription->timerfd != -1)
+            timerfd_settime(subscription->timerfd, 0, &subscription->timeout, nullptr);
 
         return 0;
     }
 
-    int EpollWatcher::Remove(int fd)
+    int EpollWatcher::Remove(int fd, Epoll *epoll)
     {
         if (context == nullptr)
             return 111;
 
+        std::map<int, Registration>::iterator it = context->fd2registration.find(fd);
+        if (it == context->fd2registration.end())
+            return ENOENT;
+
+        std::list<Subscription> &subscriptions = it->second.subscriptions;
+        std::list<Subscription>::iterator sub = subscriptions.begin();
+        while (sub != subscriptions.end() && sub->epoll != epoll)
+            ++sub;
+
+        if (sub == subscriptions.end())
+            return ENOENT;
+
+        RemoveTimer(*sub);
+        subscriptions.erase(sub);
+
+        if (!subscriptions.empty())
+            return UpdateRegistration(context, fd, it->second, false);
+
+        context->fd2registration.erase(it);
+
         if (epoll_ctl(context->epfd, EPOLL_CTL_DEL, fd, 0) == -1)
             return errno;
 
-        context->fd2epoll.erase(fd);
-
         return 0;
     }
 
@@ -196,15 +467,30 @@ namespace epoll
         if (context == nullptr)
             return;
 
-        for (std::map<int, Epoll *>::iterator it = context->fd2epoll.begin(); it != context->fd2epoll.end();)
+        for (std::map<int, Registration>::iterator it = context->fd2registration.begin(); it != context->fd2registration.end();)
         {
-            if (it->second == epoll)
+            std::list<Subscription> &subscriptions = it->second.subscriptions;
+            for (std::list<Subscription>::iterator sub = subscriptions.begin(); sub != subscriptions.end();)
+            {
+                if (sub->epoll == epoll)
+                {
+                    RemoveTimer(*sub);
+                    sub = subscriptions.erase(sub);
+                }
+                else
+                {
+                    ++sub;
+                }
+            }
+
+            if (subscriptions.empty())
             {
                 epoll_ctl(context->epfd, EPOLL_CTL_DEL, it->first, 0);
-                it = context->fd2epoll.erase(it);
+                it = context->fd2registration.erase(it);
             }
             else
             {
+                UpdateRegistration(context, it->first, it->second, false);
                 ++it;
             }
         }
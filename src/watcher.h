@@ -4,12 +4,21 @@
 
 #include <napi.h>
 
+#include <sys/timerfd.h>
+
 #include <thread>
 #include <map>
+#include <list>
+#include <vector>
 #include <atomic>
 
 namespace epoll
 {
+    // Reported in the events argument of the callback when a fd added with an
+    // inactivity timeout has had no readiness for that long. The kernel leaves this
+    // bit unused, and add and modify refuse it so it never reaches epoll_ctl.
+    constexpr uint32_t TimeoutEvent = 1u << 20;
+
     class Epoll; // Declared later
     class EpollWatcher;
 
@@ -27,12 +36,34 @@ namespace epoll
     using TSFN = Napi::TypedThreadSafeFunction<Context, DataType, CallJs>;
     using FinalizerDataType = void;
 
+    // A single Epoll instance's interest in a fd
+    struct Subscription
+    {
+        Epoll *epoll;
+        uint32_t events;
+        bool armed; // Cleared once an EPOLLONESHOT subscription has fired, until it is modified
+
+        int timerfd; // -1 when there is no inactivity timeout, paused while not armed
+        struct itimerspec timeout;
+    };
+
+    // The single kernel registration of a fd, shared by all of its subscriptions
+    struct Registration
+    {
+        uint32_t events; // The mask last passed to epoll_ctl
+        std::list<Subscription> subscriptions;
+    };
+
     struct WatcherContext
     {
         std::atomic<bool> abort_ = {false};
 
         int epfd;
-        std::map<int, Epoll *> fd2epoll;
+        std::map<int, Registration> fd2registration;
+        std::map<int, std::pair<int, Epoll *>> timer2subscription;
+
+        // Reused by CallJs so dispatching an event doesn't allocate
+        std::vector<std::pair<Epoll *, uint32_t>> targets;
 
         std::thread nativeThread;
         TSFN tsfn;
@@ -44,15 +75,17 @@ namespace epoll
         EpollWatcher(const Napi::Env &env);
         ~EpollWatcher();
 
-        int Add(int fd, uint32_t events, Epoll *epoll);
-        int Modify(int fd, uint32_t events);
-        int Remove(int fd);
+        int Add(int fd, uint32_t events, Epoll *epoll, uint32_t timeoutMs);
+        int Modify(int fd, uint32_t events, Epoll *epoll);
+        int Remove(int fd, Epoll *epoll);
         void Forget(Epoll *epoll);
 
         void HandleEvent(const Napi::Env &env, DataType *event);
 
     private:
         void Cleanup();
+        int AddTimer(int fd, Subscription &subscription, uint32_t timeoutMs);
+        void RemoveTimer(Subscription &subscription);
 
         WatcherContext *context;
     };
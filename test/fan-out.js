@@ -0,0 +1,117 @@
+'use strict';
+
+/*
+ * Make sure several Epoll instances can watch the same fd through a single
+ * kernel registration, and that each instance only sees the events it asked
+ * for.
+ *
+ * This test expects a newline as input on stdin.
+ */
+const Epoll = require('../').Epoll;
+const util = require('./util');
+const assert = require('assert');
+const fs = require('fs');
+
+const stdin = 0; // fd for stdin
+const stdout = 1; // fd for stdout
+
+const interest = Epoll.EPOLLIN | Epoll.EPOLLPRI;
+
+// The events of the kernel registration of fd, as listed in the fdinfo of the
+// watcher's epoll fd
+const registeredEvents = fd => {
+  let events;
+
+  fs.readdirSync('/proc/self/fdinfo').forEach(name => {
+    let info;
+    try {
+      info = fs.readFileSync('/proc/self/fdinfo/' + name, 'utf8');
+    } catch (err) {
+      return;
+    }
+
+    info.split('\n').forEach(line => {
+      const match = /^tfd:\s*(\d+)\s+events:\s*([0-9a-f]+)/.exec(line);
+      if (match && Number(match[1]) === fd) {
+        events = parseInt(match[2], 16) & interest;
+      }
+    });
+  });
+
+  return events;
+};
+
+// Counts the events seen by an instance, complaining about any bits outside
+// of the events it asked for. EPOLLERR and EPOLLHUP are always reported.
+const watch = events => {
+  const counts = {in: 0, hup: 0};
+
+  counts.epoll = new Epoll((err, fd, got) => {
+    if (err || fd !== stdin ||
+        (got & ~(events | Epoll.EPOLLERR | Epoll.EPOLLHUP))) {
+      console.log('*** Error: unexpected event');
+    }
+    if (got & Epoll.EPOLLIN) {
+      counts.in += 1;
+    }
+    if (got & Epoll.EPOLLHUP) {
+      counts.hup += 1;
+    }
+  });
+
+  return counts;
+};
+
+// Disjoint masks: watcher3 registers stdin first for EPOLLPRI only, then
+// watcher1 and watcher2 widen the registration with EPOLLIN
+const watcher1 = watch(Epoll.EPOLLIN | Epoll.EPOLLONESHOT);
+const watcher2 = watch(Epoll.EPOLLIN | Epoll.EPOLLONESHOT);
+const watcher3 = watch(Epoll.EPOLLPRI);
+
+watcher3.epoll.add(stdin, Epoll.EPOLLPRI);
+assert(registeredEvents(stdin) === Epoll.EPOLLPRI);
+
+watcher1.epoll.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLONESHOT);
+watcher2.epoll.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLONESHOT);
+assert(registeredEvents(stdin) === interest);
+
+assert.throws(_ => watcher1.epoll.add(stdin, Epoll.EPOLLIN));
+assert.throws(_ => watcher1.epoll.modify(stdout, Epoll.EPOLLIN), /No such file/);
+
+setTimeout(_ => {
+  // Each one-shot saw the newline exactly once, and with both fired the
+  // registration narrows back to what watcher3 asked for
+  assert(watcher1.in === 1);
+  assert(watcher2.in === 1);
+  assert(registeredEvents(stdin) === Epoll.EPOLLPRI);
+
+  // watcher3 never sees EPOLLIN, but does see EPOLLHUP as echo has closed its
+  // end of stdin
+  assert(watcher3.in === 0);
+  assert(watcher3.hup > 0);
+
+  // Removing watcher3 narrows the registration to watcher1, which keeps
+  // receiving events. Everything still armed is EPOLLET, so the kernel
+  // registration is edge-triggered from here on.
+  watcher1.epoll.modify(stdin, Epoll.EPOLLIN | Epoll.EPOLLET);
+  watcher3.epoll.remove(stdin).close();
+  assert(registeredEvents(stdin) === Epoll.EPOLLIN);
+
+  setTimeout(_ => {
+    assert(watcher1.in > 1);
+
+    // The edge has been delivered to watcher1, yet a late EPOLLET joiner
+    // still has to be told the newline is waiting to be read
+    const watcher4 = watch(Epoll.EPOLLIN | Epoll.EPOLLET);
+    watcher4.epoll.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLET);
+
+    setTimeout(_ => {
+      assert(watcher4.in === 1);
+
+      util.read(stdin); // read stdin (the newline)
+      watcher1.epoll.remove(stdin).close();
+      watcher2.epoll.remove(stdin).close();
+      watcher4.epoll.remove(stdin).close();
+    }, 100);
+  }, 100);
+}, 100);
@@ -0,0 +1,52 @@
+'use strict';
+
+/*
+ * Make sure the inactivity timeout of an EPOLLONESHOT fd is paused once the
+ * event has been reported, and is restarted by modify.
+ *
+ * This test expects a newline as input on stdin, after which stdin must stay
+ * open but silent for a couple of seconds.
+ */
+const Epoll = require('../').Epoll;
+const util = require('./util');
+const assert = require('assert');
+
+const stdin = 0; // fd for stdin
+const timeout = 250;
+
+let eventCount = 0;
+let timeoutCount = 0;
+let rearmed = 0;
+
+const epoll = new Epoll((err, fd, events) => {
+  if (err || fd !== stdin) {
+    console.log('*** Error: unexpected event');
+  } else if (events === Epoll.EPOLLTIMEOUT) {
+    timeoutCount += 1;
+
+    // A timeout before modify would be a false report, as the one-shot can't
+    // see readiness until it is re-armed
+    if (rearmed === 0 || Date.now() - rearmed < timeout - 50) {
+      console.log('*** Error: timeout while the one-shot was disarmed');
+    }
+
+    setTimeout(_ => {
+      assert(timeoutCount === 1);
+      epoll.remove(fd).close();
+    }, timeout * 2);
+  } else if ((events & Epoll.EPOLLIN) && eventCount === 0) {
+    eventCount += 1;
+    util.read(fd); // read stdin (the newline)
+
+    // Stay disarmed for well over the timeout before re-arming
+    setTimeout(_ => {
+      assert(timeoutCount === 0);
+      rearmed = Date.now();
+      epoll.modify(fd, Epoll.EPOLLIN | Epoll.EPOLLONESHOT);
+    }, timeout * 3);
+  } else {
+    console.log('*** Error: unexpected event');
+  }
+});
+
+epoll.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLONESHOT, timeout);
@@ -0,0 +1,56 @@
+'use strict';
+
+/*
+ * Make sure readiness pushes an inactivity timeout back and that exactly one
+ * timeout is reported once the fd goes silent.
+ *
+ * This test expects newlines to be written to stdin more often than every
+ * 250ms for a while, after which stdin must stay open but silent.
+ */
+const Epoll = require('../').Epoll;
+const util = require('./util');
+const assert = require('assert');
+
+const stdin = 0; // fd for stdin
+const timeout = 250;
+
+let readCount = 0;
+let timeoutCount = 0;
+let lastReady = Date.now();
+
+const epoll = new Epoll((err, fd, events) => {
+  if (err || fd !== stdin) {
+    console.log('*** Error: unexpected event');
+  } else if (events === Epoll.EPOLLTIMEOUT) {
+    timeoutCount += 1;
+
+    if (timeoutCount === 1) {
+      // Had the timer not been pushed back by readiness it would have fired
+      // while newlines were still arriving
+      if (readCount === 0 || Date.now() - lastReady < timeout - 50) {
+        console.log('*** Error: timeout while stdin was active');
+      }
+
+      setTimeout(_ => {
+        assert(timeoutCount === 1);
+        epoll.remove(fd).close();
+      }, timeout * 2);
+    }
+  } else if ((events & Epoll.EPOLLIN) && timeoutCount === 0) {
+    util.read(fd); // read stdin (the newlines)
+    readCount += 1;
+    lastReady = Date.now();
+  } else {
+    console.log('*** Error: unexpected event');
+  }
+});
+
+// Timeouts that can't be honoured exactly are refused rather than truncated
+const invalid = new Epoll(_ => {});
+assert.throws(_ => invalid.add(stdin, Epoll.EPOLLIN, -1));
+assert.throws(_ => invalid.add(stdin, Epoll.EPOLLIN, 0.5));
+assert.throws(_ => invalid.add(stdin, Epoll.EPOLLIN, 4294967296));
+assert.throws(_ => invalid.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLTIMEOUT));
+invalid.close();
+
+epoll.add(stdin, Epoll.EPOLLIN | Epoll.EPOLLET, timeout);